@@ -5,6 +5,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <stdint.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <fenv.h>
 
 // Swap our functions with prof's version
 #ifdef REF
@@ -16,6 +22,414 @@
 #define MySchedThread SchedThread
 #endif
 
+// Cycle counter for profiling and benchmarks (falls back to ns on non-x86)
+static inline unsigned long long ReadCycles()
+{
+#if defined(__i386__) || defined(__x86_64__)
+	unsigned int lo, hi;
+	__asm__ __volatile__("rdtsc"
+						 : "=a"(lo), "=d"(hi));
+	return ((unsigned long long)hi << 32) | lo;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// Wall-clock seconds, for throughput benchmarks
+static inline double ReadSeconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// ********************************
+// Thread start trampolines (used by PROFILE and GUARD)
+// ********************************
+// A wrapper layer that runs code when a thread starts creates it with its own
+// trampoline instead. The real function and parameter wait in a slot of the
+// layer's table until the trampoline takes them, the slot is its parameter.
+
+#if defined(PROFILE) || defined(GUARD)
+#define START_MAXTHREADS 10
+
+typedef struct
+{
+	void (*func)();
+	int param;
+	int inUse;
+} StartSlot;
+
+// Create the thread with create (the layer below), starting in start(slot)
+static int StartThread(StartSlot *slots, int (*create)(void (*)(), int), void (*start)(int), void (*func)(), int param)
+{
+	int slot, tid;
+
+	for (slot = 0; slot < START_MAXTHREADS && slots[slot].inUse; slot++)
+		;
+	if (slot == START_MAXTHREADS)
+	{
+		return -1; // More threads waiting to start than can exist
+	}
+	slots[slot].func = func;
+	slots[slot].param = param;
+	slots[slot].inUse = 1;
+
+	tid = create(start, slot);
+	if (tid < 0)
+	{
+		slots[slot].inUse = 0;
+	}
+	return tid;
+}
+
+// First thing a trampoline does, frees the slot
+static void (*StartTake(StartSlot *slots, int slot, int *param))()
+{
+	*param = slots[slot].param;
+	slots[slot].inUse = 0;
+	return slots[slot].func;
+}
+#endif
+
+// ********************************
+// Function-level profile (build with OPTION=-DPROFILE)
+// ********************************
+// Every call into the thread API goes through a wrapper that counts calls,
+// inclusive and exclusive cycles:
+// * Inclusive: enter to return on the calling thread. A MyYieldThread that
+//   switches away is charged for everything that runs until it gets the CPU back,
+//   so inclusive cycles of different calls overlap.
+// * Exclusive: time the CPU spends inside the package. It is charged to the call
+//   that entered the package, until some thread leaves it (a wrapper returns or a
+//   new thread starts). These add up to the package's share of the run.
+// MyExitThread (and a thread function returning) never comes back, so it only
+// gets exclusive cycles. The table is printed at process exit, tester.py merges
+// it across tests.
+
+#ifdef PROFILE
+enum
+{
+	PROF_INIT,
+	PROF_CREATE,
+	PROF_YIELD,
+	PROF_SCHED,
+	PROF_EXIT,
+	PROF_GET,
+	PROF_NUM
+};
+
+static const char *Prof_Names[PROF_NUM] = {
+	"MyInitThreads", "MyCreateThread", "MyYieldThread",
+	"MySchedThread", "MyExitThread", "MyGetThread"};
+
+static unsigned long long Prof_Calls[PROF_NUM];
+static unsigned long long Prof_Cycles[PROF_NUM];	// Inclusive
+static unsigned long long Prof_Exclusive[PROF_NUM];
+static int Prof_Active = -1; // Call the CPU is in right now, -1 for test code
+static unsigned long long Prof_Last;
+static int Prof_Printed = 0;
+
+// Charge the time up to now to the active call, then make fn active
+static void ProfSwitchAt(int fn, unsigned long long now)
+{
+	if (Prof_Active >= 0)
+	{
+		Prof_Exclusive[Prof_Active] += now - Prof_Last;
+	}
+	Prof_Last = now;
+	Prof_Active = fn;
+}
+
+static void ProfSwitchTo(int fn)
+{
+	ProfSwitchAt(fn, ReadCycles());
+}
+
+// Start time lives on the caller's stack, so it survives switching to other threads.
+// One timestamp per boundary, so exclusive cycles never exceed inclusive ones.
+#define PROF_ENTER(fn)                              \
+	unsigned long long prof_start = ReadCycles(); \
+	int prof_caller = Prof_Active;                \
+	Prof_Calls[fn]++;                             \
+	ProfSwitchAt(fn, prof_start)
+#define PROF_LEAVE(fn)                                \
+	unsigned long long prof_end = ReadCycles();     \
+	Prof_Cycles[fn] += prof_end - prof_start;       \
+	ProfSwitchAt(prof_caller, prof_end)
+
+// New threads start here, so the package's time up to their first line is
+// charged to the call that switched to them, not to the thread's own code
+static StartSlot Prof_Start[START_MAXTHREADS];
+
+static void ProfThreadStart(int slot)
+{
+	int param;
+	void (*func)() = StartTake(Prof_Start, slot, &param);
+
+	ProfSwitchTo(-1);
+	func(param);
+
+	// Returning exits the thread inside the package
+	Prof_Calls[PROF_EXIT]++;
+	ProfSwitchTo(PROF_EXIT);
+}
+
+static void ProfMyInitThreads()
+{
+	PROF_ENTER(PROF_INIT);
+	MyInitThreads();
+	PROF_LEAVE(PROF_INIT);
+}
+
+static int ProfCreate(void (*start)(), int slot)
+{
+	PROF_ENTER(PROF_CREATE);
+	int tid = MyCreateThread(start, slot);
+	PROF_LEAVE(PROF_CREATE);
+	return tid;
+}
+
+static int ProfMyCreateThread(void (*func)(), int param)
+{
+	return StartThread(Prof_Start, ProfCreate, ProfThreadStart, func, param);
+}
+
+static int ProfMyYieldThread(int t)
+{
+	PROF_ENTER(PROF_YIELD);
+	int yielder = MyYieldThread(t);
+	PROF_LEAVE(PROF_YIELD);
+	return yielder;
+}
+
+static void ProfMySchedThread()
+{
+	PROF_ENTER(PROF_SCHED);
+	MySchedThread();
+	PROF_LEAVE(PROF_SCHED);
+}
+
+static void ProfMyExitThread()
+{
+	Prof_Calls[PROF_EXIT]++;
+	ProfSwitchTo(PROF_EXIT);
+	MyExitThread();
+}
+
+static int ProfMyGetThread()
+{
+	PROF_ENTER(PROF_GET);
+	int tid = MyGetThread();
+	PROF_LEAVE(PROF_GET);
+	return tid;
+}
+
+// Format is parsed by tester.py, keep in sync
+static void ProfReport()
+{
+	int i;
+
+	if (Prof_Printed)
+	{
+		return;
+	}
+	Prof_Printed = 1;
+
+	// Close the last interval (e.g. the final MyExitThread)
+	ProfSwitchTo(-1);
+
+	DPrintf("\nPROFILE: %-16s %12s %16s %16s %14s\n", "function", "calls", "incl_cycles", "excl_cycles", "excl/call");
+	for (i = 0; i < PROF_NUM; i++)
+	{
+		DPrintf("PROFILE: %-16s %12llu %16llu %16llu %14llu\n", Prof_Names[i], Prof_Calls[i], Prof_Cycles[i],
+				Prof_Exclusive[i], Prof_Calls[i] ? Prof_Exclusive[i] / Prof_Calls[i] : 0);
+	}
+}
+
+// Redirect the tests below to the wrappers (bodies above already call the real ones)
+#undef MyInitThreads
+#undef MyCreateThread
+#undef MyYieldThread
+#undef MySchedThread
+#undef MyExitThread
+#undef MyGetThread
+#define MyInitThreads ProfMyInitThreads
+#define MyCreateThread ProfMyCreateThread
+#define MyYieldThread ProfMyYieldThread
+#define MySchedThread ProfMySchedThread
+#define MyExitThread ProfMyExitThread
+#define MyGetThread ProfMyGetThread
+#endif
+
+// ********************************
+// Stack guard pages (build with OPTION=-DGUARD)
+// ********************************
+// Each created thread gets a PROT_NONE page STACKBUDGET bytes (default 16384)
+// below the frame its function starts in. Using more stack than that faults, and
+// a SIGSEGV handler on an alternate signal stack reports the thread instead of
+// letting it run into its neighbour's stack. STACKBUDGET must stay below your
+// STACKSIZE. Thread 0 runs on the process stack and is not guarded.
+// Test21 compares the cost against software canaries (run it in a normal build).
+
+#define GUARD_MAXTHREADS 10
+#define CANARY_WORDS 4
+#define CANARY_VALUE 0xDEADBEEFCAFEF00DULL
+
+static int Guard_Budget = 16384;
+static long Guard_PageSize;
+static char *Guard_Page[GUARD_MAXTHREADS]; // Guard page of each thread ID, NULL if none
+static int Guard_ExpectOverflow = 0;		   // Set by Test20, where an overflow is the pass
+static char Guard_AltStack[65536];
+
+static void GuardHandler(int sig, siginfo_t *info, void *context)
+{
+	char *addr = (char *)info->si_addr;
+	int t;
+
+	for (t = 0; t < GUARD_MAXTHREADS; t++)
+	{
+		if (Guard_Page[t] != NULL && addr >= Guard_Page[t] && addr < Guard_Page[t] + Guard_PageSize)
+		{
+			if (Guard_ExpectOverflow)
+			{
+				DPrintf("✅ PASSED: Stack overflow caught in thread %d (budget = %d bytes).\n", t, Guard_Budget);
+			}
+			else
+			{
+				DPrintf("❌ ASSERTION FAILURE: Stack overflow in thread %d (budget = %d bytes).\n", t, Guard_Budget);
+			}
+			Exit();
+		}
+	}
+
+	// Not a guard page, let it crash as usual
+	signal(SIGSEGV, SIG_DFL);
+}
+
+void GuardInit()
+{
+	stack_t ss;
+	struct sigaction sa;
+	char *budget = getenv("STACKBUDGET");
+
+	if (budget != NULL && atoi(budget) > 0)
+	{
+		Guard_Budget = atoi(budget);
+	}
+	Guard_PageSize = sysconf(_SC_PAGESIZE);
+
+	// The faulting stack is unusable, so the handler needs its own
+	ss.ss_sp = Guard_AltStack;
+	ss.ss_size = sizeof(Guard_AltStack);
+	ss.ss_flags = 0;
+	sigaltstack(&ss, NULL);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = GuardHandler;
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGSEGV, &sa, NULL);
+}
+
+void GuardRemove(int tid)
+{
+	if (Guard_Page[tid] != NULL)
+	{
+		mprotect(Guard_Page[tid], Guard_PageSize, PROT_READ | PROT_WRITE);
+		Guard_Page[tid] = NULL;
+	}
+}
+
+// entry: a local in the thread's first frame. Returns 0 if it couldn't be guarded.
+int GuardInstall(int tid, char *entry)
+{
+	// A stale guard means the previous owner of this ID exited without removing it
+	GuardRemove(tid);
+
+	char *page = (char *)(((uintptr_t)(entry - Guard_Budget) & ~(uintptr_t)(Guard_PageSize - 1)) - Guard_PageSize);
+
+	// The process stack is only mapped as it grows, touch the page and retry if needed
+	if (mprotect(page, Guard_PageSize, PROT_NONE) != 0)
+	{
+		*(volatile char *)page = 0;
+		if (mprotect(page, Guard_PageSize, PROT_NONE) != 0)
+		{
+			return 0;
+		}
+	}
+	Guard_Page[tid] = page;
+	return 1;
+}
+
+// Software alternative: a few known words where the guard page would be.
+// Only finds an overflow when checked, and only if the words were overwritten.
+static unsigned long long *CanaryAt(char *entry)
+{
+	return (unsigned long long *)(((uintptr_t)(entry - Guard_Budget) & ~(uintptr_t)7) - CANARY_WORDS * sizeof(unsigned long long));
+}
+
+void CanaryPlace(char *entry)
+{
+	int i;
+	unsigned long long *canary = CanaryAt(entry);
+	for (i = 0; i < CANARY_WORDS; i++)
+	{
+		canary[i] = CANARY_VALUE;
+	}
+}
+
+// Returns 1 if the canary is intact
+int CanaryCheck(char *entry)
+{
+	int i;
+	unsigned long long *canary = CanaryAt(entry);
+	for (i = 0; i < CANARY_WORDS; i++)
+	{
+		if (canary[i] != CANARY_VALUE)
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+#ifdef GUARD
+// New threads start in GuardThreadStart, which takes the real function from here
+static StartSlot Guard_Start[START_MAXTHREADS];
+
+static void GuardThreadStart(int slot)
+{
+	char entry;
+	int param;
+	void (*func)() = StartTake(Guard_Start, slot, &param);
+	int tid = MyGetThread();
+
+	GuardInstall(tid, &entry);
+	func(param);
+	GuardRemove(tid);
+}
+
+static int GuardMyCreateThread(void (*func)(), int param)
+{
+	return StartThread(Guard_Start, MyCreateThread, GuardThreadStart, func, param);
+}
+
+static void GuardMyExitThread()
+{
+	GuardRemove(MyGetThread());
+	MyExitThread();
+}
+
+// Same trick as PROFILE, the wrappers above already call the previous layer
+#undef MyCreateThread
+#undef MyExitThread
+#define MyCreateThread GuardMyCreateThread
+#define MyExitThread GuardMyExitThread
+#endif
+
 // Use for test of result directly (if needed)
 void MyTestAssert(int expression, const char *message, int LINE)
 {
@@ -60,9 +474,16 @@ void MyTestAssertEqualString(const char *actual, const char *expected, const cha
 	}
 }
 
+// For tests that can't run in this build, tester.py reports them as skipped
+void MyTestSkip(const char *message)
+{
+	DPrintf("⏭️  SKIPPED: %s\n", message);
+}
+
 #define ASSERT(expression, message) MyTestAssert(expression, message, __LINE__)
 #define ASSERT_EQUAL(actual, expected, message) MyTestAssertEqualInt(actual, expected, message, __LINE__)
 #define ASSERT_EQUAL_STR(actual, expected, message) MyTestAssertEqualString(actual, expected, message, __LINE__)
+#define SKIP(message) MyTestSkip(message)
 
 // Global var to store msg string with sprintf
 char msg[200];
@@ -73,6 +494,246 @@ void printParam(int param)
 	DPrintf("Print with param = %d\n", param);
 }
 
+// Benchmark results, parsed by tester.py (keep the format in sync)
+void BenchReport(const char *name, const char *metric, double value)
+{
+	DPrintf("📊 BENCH: %s %s = %.1f\n", name, metric, value);
+}
+
+// Iterations for benchmarks, override with ITERS
+int BenchIters()
+{
+	char *iters = getenv("ITERS");
+	return (iters != NULL && atoi(iters) > 0) ? atoi(iters) : 10000;
+}
+
+// Yield ping-pong between thread 0 and a new partner, shared by the benchmarks.
+// Both sides run loop(side, iters, to): iters rounds of its own work and a
+// PingPongSwitch(to). Thread 0 is side 0 (2 * iters switches), the partner
+// exits after. to = -1 runs the same loop without switching, for baselines.
+static int PingPong_Iters;
+static void (*PingPong_Loop)(int side, int iters, int to);
+
+// Not inlined, so a baseline loop makes the same call as a switching one
+__attribute__((noinline)) int PingPongSwitch(int to)
+{
+	if (to < 0)
+	{
+		return to;
+	}
+	return MyYieldThread(to);
+}
+
+// Plain loop, no work between switches
+void PingPongYield(int side, int iters, int to)
+{
+	int i;
+	for (i = 0; i < iters; i++)
+	{
+		PingPongSwitch(to);
+	}
+}
+
+void PingPongPartner(int param)
+{
+	PingPong_Loop(1, PingPong_Iters, 0);
+}
+
+void PingPong(int iters, void (*loop)(int side, int iters, int to), unsigned long long *cycles, double *seconds)
+{
+	int tid;
+	unsigned long long startCycles;
+	double startSeconds;
+
+	PingPong_Iters = iters;
+	PingPong_Loop = loop;
+	tid = MyCreateThread(PingPongPartner, 0);
+
+	startSeconds = ReadSeconds();
+	startCycles = ReadCycles();
+	loop(0, iters, tid);
+	*cycles = ReadCycles() - startCycles;
+	*seconds = ReadSeconds() - startSeconds;
+
+	// Let the partner finish
+	ASSERT_EQUAL(MyYieldThread(tid), -1, "Ping-pong thread must exit.");
+}
+
+// ********************************
+// Scheduling policy model
+// ********************************
+// Expected orders in Test 4, 9, 15 and 16 are derived by replaying the scenario
+// on this model, so the same tests check any policy your package implements.
+// Select it with POLICY=FIFO|LIFO|PRIO (default FIFO):
+// * FIFO: run the thread that has been ready the longest.
+// * LIFO: run the thread that became ready most recently.
+// * PRIO: static priority, lowest thread ID first.
+// MyYieldThread(t) always runs t, the yielder goes to the end of the ready queue.
+
+#define MODEL_MAXTHREADS 10
+
+typedef struct
+{
+	const char *name;
+	int (*pick)(const int *ready, int numReady); // Index of the ready thread to run next
+} SchedPolicy;
+
+int PickFIFO(const int *ready, int numReady)
+{
+	return 0;
+}
+
+int PickLIFO(const int *ready, int numReady)
+{
+	return numReady - 1;
+}
+
+int PickPRIO(const int *ready, int numReady)
+{
+	int i, best = 0;
+	for (i = 1; i < numReady; i++)
+	{
+		if (ready[i] < ready[best])
+		{
+			best = i;
+		}
+	}
+	return best;
+}
+
+static const SchedPolicy Policies[] = {
+	{"FIFO", PickFIFO},
+	{"LIFO", PickLIFO},
+	{"PRIO", PickPRIO}};
+
+static const SchedPolicy *Policy = &Policies[0];
+
+static int Model_Valid[MODEL_MAXTHREADS];
+static int Model_Resume[MODEL_MAXTHREADS]; // What the thread's pending MyYieldThread returns
+static int Model_Ready[MODEL_MAXTHREADS];  // Ready queue, oldest first
+static int Model_NumReady;
+static int Model_Running; // -1 once every thread has exited
+static int Model_LastCreated;
+
+// Returns 0 if name is not a known policy
+int SelectPolicy(const char *name)
+{
+	int i;
+	for (i = 0; i < sizeof(Policies) / sizeof(Policies[0]); i++)
+	{
+		if (strcmp(Policies[i].name, name) == 0)
+		{
+			Policy = &Policies[i];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void ModelInit()
+{
+	memset(Model_Valid, 0, sizeof(Model_Valid));
+	Model_Valid[0] = 1;
+	Model_NumReady = 0;
+	Model_Running = 0;
+	Model_LastCreated = 0;
+}
+
+// IDs are handed out round robin, starting after the last created one
+int ModelCreate()
+{
+	int i, t;
+	for (i = 1; i <= MODEL_MAXTHREADS; i++)
+	{
+		t = (Model_LastCreated + i) % MODEL_MAXTHREADS;
+		if (!Model_Valid[t])
+		{
+			Model_Valid[t] = 1;
+			Model_LastCreated = t;
+			Model_Ready[Model_NumReady++] = t;
+			return t;
+		}
+	}
+	return -1;
+}
+
+static void ModelRemoveReady(int index)
+{
+	Model_NumReady--;
+	memmove(&Model_Ready[index], &Model_Ready[index + 1], (Model_NumReady - index) * sizeof(int));
+}
+
+// Run the thread chosen by the policy, it resumes with -1
+static void ModelDispatch()
+{
+	if (Model_NumReady == 0)
+	{
+		Model_Running = -1;
+		return;
+	}
+	int index = Policy->pick(Model_Ready, Model_NumReady);
+	Model_Running = Model_Ready[index];
+	Model_Resume[Model_Running] = -1;
+	ModelRemoveReady(index);
+}
+
+// Yield to self or an invalid thread doesn't switch, the result is in Model_Resume
+void ModelYield(int t)
+{
+	int i, me = Model_Running;
+
+	if (t < 0 || t >= MODEL_MAXTHREADS || !Model_Valid[t])
+	{
+		Model_Resume[me] = -1;
+		return;
+	}
+	if (t == me)
+	{
+		Model_Resume[me] = me;
+		return;
+	}
+	for (i = 0; Model_Ready[i] != t; i++)
+		;
+	ModelRemoveReady(i);
+	Model_Ready[Model_NumReady++] = me;
+	Model_Resume[t] = me;
+	Model_Running = t;
+}
+
+void ModelSched()
+{
+	Model_Ready[Model_NumReady++] = Model_Running;
+	ModelDispatch();
+}
+
+void ModelExit()
+{
+	Model_Valid[Model_Running] = 0;
+	ModelDispatch();
+}
+
+// Play the other threads with step() until thread 0 gets the CPU back (or all exit)
+void ModelRunUntilMain(void (*step)(int tid))
+{
+	while (Model_Running > 0)
+	{
+		step(Model_Running);
+	}
+}
+
+// Message for a MyYieldThread expected to return yielder (from the model)
+void YielderMessage(int yielder)
+{
+	if (yielder == -1)
+	{
+		sprintf(msg, "Must get the CPU back at another thread's exit, so it must return -1.");
+	}
+	else
+	{
+		sprintf(msg, "Thread %d must yield back.", yielder);
+	}
+}
+
 // ********************************
 // Test creating threads
 // ********************************
@@ -140,8 +801,72 @@ void Test3()
 	MyExitThread();
 }
 
-// This is thread 2
-void Test4_Thread2YieldBackTo0After1And3Exit(int param)
+static int Test4_ExpectedMainYielder;
+static int Test4_ExpectedNewIds[4];
+static int Test4_ExpectedThread2Yielder;
+static int Test4_ModelIsThread2[MODEL_MAXTHREADS];
+static int Test4_ModelPhase[MODEL_MAXTHREADS];
+
+void Test4_ModelStep(int tid)
+{
+	if (Test4_ModelIsThread2[tid] && Test4_ModelPhase[tid]++ == 0)
+	{
+		ModelYield(0);
+		return;
+	}
+	if (Test4_ModelIsThread2[tid])
+	{
+		Test4_ExpectedThread2Yielder = Model_Resume[tid];
+	}
+	ModelExit();
+}
+
+// Same steps as Test4 below, on the model
+void Test4_Model()
+{
+	int i, tid;
+
+	memset(Test4_ModelIsThread2, 0, sizeof(Test4_ModelIsThread2));
+	memset(Test4_ModelPhase, 0, sizeof(Test4_ModelPhase));
+
+	ModelInit();
+	for (i = 1; i <= 7; i++)
+	{
+		Test4_ModelIsThread2[ModelCreate()] = (i == 2);
+	}
+	ModelYield(3);
+	ModelRunUntilMain(Test4_ModelStep);
+
+	Test4_ExpectedMainYielder = Model_Resume[0];
+	for (i = 0; i < 4; i++)
+	{
+		tid = ModelCreate();
+		Test4_ExpectedNewIds[i] = tid;
+		if (tid >= 0)
+		{
+			Test4_ModelIsThread2[tid] = 0;
+			Test4_ModelPhase[tid] = 0;
+		}
+	}
+	ModelExit();
+	ModelRunUntilMain(Test4_ModelStep);
+}
+
+// Message for the i-th ID created after thread 2 yields back
+void Test4_NewIdMessage(int i, int tid)
+{
+	if (Test4_ExpectedNewIds[i] == -1)
+	{
+		sprintf(msg, "New thread must fail with -1 as no ID is free (actual = %d).", tid);
+	}
+	else
+	{
+		sprintf(msg, "New thread must have ID = %d (actual = %d).", Test4_ExpectedNewIds[i], tid);
+	}
+}
+
+// This is thread 2
+void Test4_Thread2YieldBackTo0After1And3Exit(int param)
 {
 	ASSERT_EQUAL(MyGetThread(), 2, "This must be thread 2.");
 
@@ -155,16 +880,28 @@ void Test4_Thread2YieldBackTo0After1And3Exit(int param)
 
 	// Then during this time 8,9,1,3 are created by 0: [0,4,5,6,7,2, <<< 8,9,1,3]
 	// It continues one by one (FIFO order), and 7 must be the one who yields back to 2 on exit.
-	ASSERT_EQUAL(yielder, -1, "Thread 7 must yield back to here to 2, but it yields at thread exit, so it must return -1.");
+	if (Test4_ExpectedThread2Yielder == -1)
+	{
+		sprintf(msg, "Thread 2 must get the CPU back at another thread's exit, so it must return -1.");
+	}
+	else
+	{
+		sprintf(msg, "Thread %d must yield back to 2.", Test4_ExpectedThread2Yielder);
+	}
+	ASSERT_EQUAL(yielder, Test4_ExpectedThread2Yielder, msg);
 }
 
 // Multiple things are tested here, not very clean...but it should pass
 void Test4()
 {
-	DPrintf("TEST: Create thread 1 to 7. Then Thread 3 and 1 leave (by yielding to 3 and let both exits naturally), then 2 must get scheduled due to FIFO.\n");
-	DPrintf("* Thread 2 then yields back to thread 0 to create new threads.\n");
-	DPrintf("* Next two new thread IDs must continue at 8 and 9. Then another two must then reuse ID 1 and 3.\n");
-	DPrintf("* Then all are scheduled with current FIFO order... 7 must exit and then 2 get to continue, MyYieldThread must return -1.\n");
+	// Comments below walk through FIFO, expected values come from the model
+	Test4_Model();
+
+	DPrintf("TEST: Create thread 1 to 7. Then 0 yields to 3 and threads run in %s order until 0 gets the CPU back (thread 2 yields back to 0 when it first runs).\n", Policy->name);
+	DPrintf("* Thread 0 then creates 4 new threads, their IDs must be %d, %d, %d and %d (-1 if no ID is free).\n",
+			Test4_ExpectedNewIds[0], Test4_ExpectedNewIds[1], Test4_ExpectedNewIds[2], Test4_ExpectedNewIds[3]);
+	DPrintf("* Then all run in %s order until they exit, thread 2's MyYieldThread must return %d.\n", Policy->name, Test4_ExpectedThread2Yielder);
+
 	MyInitThreads();
 
 	int i;
@@ -193,27 +930,28 @@ void Test4()
 	// Next it will be 1 who get scheduled, again it prints and exit.
 	// Then 2 will get which will yield back here: [2,4,5,6,7,0]
 	int yieldingThread = MyYieldThread(3);
-	ASSERT_EQUAL(yieldingThread, 2, "Thread 2 must yield back.");
+	YielderMessage(Test4_ExpectedMainYielder);
+	ASSERT_EQUAL(yieldingThread, Test4_ExpectedMainYielder, msg);
 
 	// Here now is [0,4,5,6,7,2]
 
-	// Create two more, IDs must be 8 and 9
+	// Create two more, IDs must be 8 and 9 (FIFO)
 	tid = MyCreateThread(printParam, 8);
-	sprintf(msg, "New thread must have ID = 8 (actual = %d).", tid);
-	ASSERT_EQUAL(tid, 8, msg);
+	Test4_NewIdMessage(0, tid);
+	ASSERT_EQUAL(tid, Test4_ExpectedNewIds[0], msg);
 
 	tid = MyCreateThread(printParam, 9);
-	sprintf(msg, "New thread must have ID = 9 (actual = %d).", tid);
-	ASSERT_EQUAL(tid, 9, msg);
+	Test4_NewIdMessage(1, tid);
+	ASSERT_EQUAL(tid, Test4_ExpectedNewIds[1], msg);
 
 	// Then another two must be 1 and 3 (reusing IDs)
 	tid = MyCreateThread(printParam, 1);
-	sprintf(msg, "New thread must have ID = 1 (actual = %d).", tid);
-	ASSERT_EQUAL(tid, 1, msg);
+	Test4_NewIdMessage(2, tid);
+	ASSERT_EQUAL(tid, Test4_ExpectedNewIds[2], msg);
 
 	tid = MyCreateThread(printParam, 3);
-	sprintf(msg, "New thread must have ID = 3 (actual = %d).", tid);
-	ASSERT_EQUAL(tid, 3, msg);
+	Test4_NewIdMessage(3, tid);
+	ASSERT_EQUAL(tid, Test4_ExpectedNewIds[3], msg);
 
 	// Now it's [0,4,5,6,7,2, <<<<  8,9,1,3] (i.e. 0 creates 8,9,1,3);
 	// Next it should go in order of FIFO above until all are finished...
@@ -272,7 +1010,7 @@ void Test8_YieldBackToThread0(int param)
 {
 	// Immediately yield back
 	int yielder = MyYieldThread(0);
-	ASSERT_EQUAL(yielder, -1, "Yielder must be -1 as all are exiting in FIFO order...");
+	ASSERT_EQUAL(yielder, -1, "Yielder must be -1 as the CPU comes back at another thread's exit.");
 }
 
 void Test8()
@@ -304,6 +1042,52 @@ void Test8()
 	MyExitThread();
 }
 
+static int Test9_ExpectedMainYielder;
+static int Test9_ExpectedFirstYielder[MODEL_MAXTHREADS]; // Yielder on the way back 9 -> 0
+static int Test9_ExpectedLastYielder[MODEL_MAXTHREADS];	 // Yielder when it finally resumes
+static int Test9_ModelPhase[MODEL_MAXTHREADS];
+
+void Test9_ModelStep(int tid)
+{
+	switch (Test9_ModelPhase[tid]++)
+	{
+	case 0:
+		ModelYield(tid == 9 ? 8 : tid + 1);
+		break;
+	case 1:
+		if (tid != 9)
+		{
+			Test9_ExpectedFirstYielder[tid] = Model_Resume[tid];
+			ModelYield(tid - 1);
+			break;
+		}
+		// Fall through, 9 only yields once
+	default:
+		Test9_ExpectedLastYielder[tid] = Model_Resume[tid];
+		ModelExit();
+	}
+}
+
+// Same steps as Test9 below, on the model
+void Test9_Model()
+{
+	int i;
+
+	memset(Test9_ModelPhase, 0, sizeof(Test9_ModelPhase));
+
+	ModelInit();
+	for (i = 1; i <= 9; i++)
+	{
+		ModelCreate();
+	}
+	ModelYield(1);
+	ModelRunUntilMain(Test9_ModelStep);
+
+	Test9_ExpectedMainYielder = Model_Resume[0];
+	ModelExit();
+	ModelRunUntilMain(Test9_ModelStep);
+}
+
 void Test9_YieldRoundtrip(int tid)
 {
 	sprintf(msg, "Current thread must be %d", tid);
@@ -327,19 +1111,21 @@ void Test9_YieldRoundtrip(int tid)
 		// Here it got yield back (i.e. 8 from 9 above), just continue to yield back i.e.:
 		// 8->7->...->0
 
-		sprintf(msg, "Thread %d must yield back to current thread (%d).", tid + 1, MyGetThread());
-		ASSERT_EQUAL(yielder, tid + 1, msg);
+		sprintf(msg, "Thread %d must yield back to current thread (%d).", Test9_ExpectedFirstYielder[tid], MyGetThread());
+		ASSERT_EQUAL(yielder, Test9_ExpectedFirstYielder[tid], msg);
 
 		yielder = MyYieldThread(tid - 1); // Finally this will hit back at 0 and 0 exits. Will return -1 all here.
 	}
 
-	sprintf(msg, "Yielder to current thread %d must be -1.", MyGetThread());
-	ASSERT_EQUAL(yielder, -1, msg);
+	sprintf(msg, "Yielder to current thread %d must be %d.", MyGetThread(), Test9_ExpectedLastYielder[tid]);
+	ASSERT_EQUAL(yielder, Test9_ExpectedLastYielder[tid], msg);
 }
 
 void Test9()
 {
-	DPrintf("TEST: Yield 0 -> 1 -> 2 -> ... -> 9 then back 9 -> 8 -> ... -> 0. Finally let all exits in FIFO.\n");
+	Test9_Model();
+
+	DPrintf("TEST: Yield 0 -> 1 -> 2 -> ... -> 9 then back 9 -> 8 -> ... -> 0. Finally let all exits in %s order.\n", Policy->name);
 
 	MyInitThreads();
 
@@ -351,7 +1137,8 @@ void Test9()
 
 	int yielder = MyYieldThread(1);
 
-	ASSERT_EQUAL(yielder, 1, "Thread 1 must yield back to 0.");
+	YielderMessage(Test9_ExpectedMainYielder);
+	ASSERT_EQUAL(yielder, Test9_ExpectedMainYielder, msg);
 
 	// Then 0 exits and let all exits...
 	MyExitThread();
@@ -515,15 +1302,75 @@ void Test14()
 static size_t Test15_Counter = 0;
 static int Test15_ThreadOrderRecord[18] = {0};
 
-void Test15_JustCallSchedThreadAndRecord(int param)
+static int Test15_ExpectedMainYielder;
+static int Test15_ExpectedCounter; // Records thread 0 sees before it exits
+static int Test15_ExpectedTotal;   // Records once every thread has exited
+static int Test15_ExpectedOrder[18];
+static int Test15_ModelPhase[MODEL_MAXTHREADS];
+
+void Test15_ModelStep(int tid)
+{
+	Test15_ExpectedOrder[Test15_ExpectedTotal++] = tid;
+	if (Test15_ModelPhase[tid]++ == 0)
+	{
+		ModelSched();
+	}
+	else
+	{
+		ModelExit();
+	}
+}
+
+// Same steps as Test15 below, on the model
+void Test15_Model()
+{
+	int i;
+
+	memset(Test15_ModelPhase, 0, sizeof(Test15_ModelPhase));
+	Test15_ExpectedTotal = 0;
+
+	ModelInit();
+	for (i = 1; i <= 9; i++)
+	{
+		ModelCreate();
+	}
+	ModelYield(1);
+	ModelRunUntilMain(Test15_ModelStep);
+
+	Test15_ExpectedMainYielder = Model_Resume[0];
+	ModelSched();
+	ModelRunUntilMain(Test15_ModelStep);
+	Test15_ExpectedCounter = Test15_ExpectedTotal;
+
+	ModelExit();
+	ModelRunUntilMain(Test15_ModelStep);
+}
+
+// Under policies where thread 0 gets the CPU back early, the rest of the order
+// is only known after 0 exits, so the last record checks it
+void Test15_Record()
 {
+	int i;
+
 	Test15_ThreadOrderRecord[Test15_Counter] = MyGetThread();
 	Test15_Counter += 1;
 
+	if (Test15_Counter == Test15_ExpectedTotal && Test15_ExpectedCounter < Test15_ExpectedTotal)
+	{
+		for (i = Test15_ExpectedCounter; i < Test15_Counter; i++)
+		{
+			ASSERT_EQUAL(Test15_ThreadOrderRecord[i], Test15_ExpectedOrder[i], "Correct order after thread 0 exits.");
+		}
+	}
+}
+
+void Test15_JustCallSchedThreadAndRecord(int param)
+{
+	Test15_Record();
+
 	MySchedThread();
 
-	Test15_ThreadOrderRecord[Test15_Counter] = MyGetThread();
-	Test15_Counter += 1;
+	Test15_Record();
 
 	if (Test15_Counter > 18)
 	{
@@ -533,9 +1380,10 @@ void Test15_JustCallSchedThreadAndRecord(int param)
 
 void Test15()
 {
-	DPrintf("TEST: MySchedThread with simple FIFO, will schedule next one in chain.\n");
-
 	Test15_Counter = 0;
+	Test15_Model();
+
+	DPrintf("TEST: MySchedThread under %s, threads 1 to 9 call it once each and must be scheduled in %s order.\n", Policy->name, Policy->name);
 
 	MyInitThreads();
 
@@ -553,7 +1401,8 @@ void Test15()
 	// [9, 0, 1, 2, 3, 4, 5, 6, 7, 8]
 	// [0, 1, 2, 3, 4, 5, 6, 7, 8, 9] <- Back to 0
 	int yielder = MyYieldThread(1);
-	ASSERT_EQUAL(yielder, -1, "Must get back to here with -1.");
+	YielderMessage(Test15_ExpectedMainYielder);
+	ASSERT_EQUAL(yielder, Test15_ExpectedMainYielder, msg);
 
 	MySchedThread(); // Go to 1 and let all runs, until back here...
 	// I.e.
@@ -564,10 +1413,9 @@ void Test15()
 	// [9, 0]
 	// [0] ...Continue below
 
-	// Start checking the order below.
-	int Test15_ExpectedOrder[18] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 1, 2, 3, 4, 5, 6, 7, 8, 9};
-
-	ASSERT_EQUAL(Test15_Counter, 18, "Counter must be 18 here.");
+	// Start checking the order below (FIFO: 1...9 twice).
+	sprintf(msg, "Counter must be %d here.", Test15_ExpectedCounter);
+	ASSERT_EQUAL(Test15_Counter, Test15_ExpectedCounter, msg);
 
 	for (i = 0; i < Test15_Counter; i++)
 	{
@@ -580,6 +1428,55 @@ static int Test16_SetupPhase = 1;
 static size_t Test16_Counter = 0;
 static int Test16_ThreadOrderRecord[9];
 
+// Order of MyYieldThread calls in Test16's setup
+static const int Test16_SetupYields[6] = {5, 7, 3, 9, 1, 4};
+
+static int Test16_ExpectedCounter; // Records thread 0 sees before it exits
+static int Test16_ExpectedTotal;   // Records once every thread has exited
+static int Test16_ExpectedOrder[9];
+static int Test16_ModelSetupPhase;
+static int Test16_ModelPhase[MODEL_MAXTHREADS];
+
+void Test16_ModelStep(int tid)
+{
+	if (Test16_ModelSetupPhase && Test16_ModelPhase[tid]++ == 0)
+	{
+		ModelYield(0);
+		return;
+	}
+	Test16_ExpectedOrder[Test16_ExpectedTotal++] = tid;
+	ModelExit();
+}
+
+// Same steps as Test16 below, on the model
+void Test16_Model()
+{
+	int i;
+
+	memset(Test16_ModelPhase, 0, sizeof(Test16_ModelPhase));
+	Test16_ExpectedTotal = 0;
+	Test16_ModelSetupPhase = 1;
+
+	ModelInit();
+	for (i = 1; i <= 9; i++)
+	{
+		ModelCreate();
+	}
+	for (i = 0; i < 6; i++)
+	{
+		ModelYield(Test16_SetupYields[i]);
+		ModelRunUntilMain(Test16_ModelStep);
+	}
+
+	Test16_ModelSetupPhase = 0;
+	ModelSched();
+	ModelRunUntilMain(Test16_ModelStep);
+	Test16_ExpectedCounter = Test16_ExpectedTotal;
+
+	ModelExit();
+	ModelRunUntilMain(Test16_ModelStep);
+}
+
 void Test16_DummyThread(int param)
 {
 	if (Test16_SetupPhase)
@@ -595,18 +1492,36 @@ void Test16_DummyThread(int param)
 	{
 		ASSERT(0, "Counter should never go beyond 9.");
 	}
+
+	// Same as Test15, exits after thread 0 left are checked by the last one
+	if (Test16_Counter == Test16_ExpectedTotal && Test16_ExpectedCounter < Test16_ExpectedTotal)
+	{
+		int i;
+		for (i = Test16_ExpectedCounter; i < Test16_Counter; i++)
+		{
+			ASSERT_EQUAL(Test16_ThreadOrderRecord[i], Test16_ExpectedOrder[i], "Correct order after thread 0 exits.");
+		}
+	}
 }
 
 // Test some specific order of exits
 void Test16()
 {
-	DPrintf("TEST: Threads exit in FIFO order after setup (2, 6, 8, 5, 7, 3, 9, 1, 4).\n");
+	int i;
+
+	Test16_Model();
+
+	DPrintf("TEST: Threads exit in %s order after setup (", Policy->name);
+	for (i = 0; i < Test16_ExpectedTotal; i++)
+	{
+		DPrintf(i == 0 ? "%d" : ", %d", Test16_ExpectedOrder[i]);
+	}
+	DPrintf(").\n");
 
 	MyInitThreads();
 
 	Test16_SetupPhase = 1;
 
-	int i;
 	for (i = 1; i <= 9; i++) // Create thread 1 to 9
 	{
 		MyCreateThread(Test16_DummyThread, i);
@@ -639,9 +1554,8 @@ void Test16()
 	// Finish all threads, back to 0
 	MySchedThread();
 
-	int Test16_ExpectedOrder[9] = {2, 6, 8, 5, 7, 3, 9, 1, 4};
-
-	ASSERT_EQUAL(Test16_Counter, 9, "Counter must be 9 here.");
+	sprintf(msg, "Counter must be %d here.", Test16_ExpectedCounter);
+	ASSERT_EQUAL(Test16_Counter, Test16_ExpectedCounter, msg);
 
 	for (i = 0; i < Test16_Counter; i++)
 	{
@@ -748,6 +1662,740 @@ void Test17()
 	MyExitThread();
 }
 
+// ********************************
+// 	Test18 is a benchmark
+// ********************************
+// Scheduling latency under the selected POLICY, in rounds shaped like Test15/16:
+// 9 threads each call MySchedThread TEST18_SCHEDS times and exit, the last one
+// out creates the next round's 9. Exits switch under every policy, and a
+// MySchedThread does when the policy picks another thread (every call under
+// FIFO, none under LIFO, and under PRIO none, since each thread becomes the top
+// thread once the lower IDs have exited). Latency runs from a MySchedThread or
+// MyExitThread call to the next thread resuming, calls that pick the caller
+// again are counted in no_switch_pct instead. cycles_per_round covers the same
+// API calls under every policy (the explicit MyYieldThread ping-pong is in Test19).
+
+#define TEST18_SCHEDS 10
+
+static int Test18_Rounds, Test18_Round, Test18_Exited;
+static int Test18_Caller; // Last thread to call MySchedThread or MyExitThread
+static unsigned long long Test18_CallStart, Test18_Start;
+static unsigned long long Test18_SwitchCycles, Test18_Switches, Test18_NoSwitches;
+
+// Call just before giving up the CPU
+static void Test18_Leave(int me)
+{
+	Test18_Caller = me;
+	Test18_CallStart = ReadCycles();
+}
+
+// Call on getting the CPU, charges the switch if another thread gave it up
+static void Test18_Resume(int me)
+{
+	unsigned long long now = ReadCycles();
+
+	if (Test18_Caller == me)
+	{
+		Test18_NoSwitches++;
+	}
+	else
+	{
+		Test18_SwitchCycles += now - Test18_CallStart;
+		Test18_Switches++;
+	}
+}
+
+void Test18_Worker(int param)
+{
+	int i, me = MyGetThread();
+
+	Test18_Resume(me);
+	for (i = 0; i < TEST18_SCHEDS; i++)
+	{
+		Test18_Leave(me);
+		MySchedThread();
+		Test18_Resume(me);
+	}
+
+	// Last one out starts the next round or reports
+	if (++Test18_Exited == 9)
+	{
+		Test18_Exited = 0;
+		if (++Test18_Round < Test18_Rounds)
+		{
+			for (i = 0; i < 9; i++)
+			{
+				if (MyCreateThread(Test18_Worker, i) < 0)
+				{
+					ASSERT(0, "Next round thread must be created.");
+				}
+			}
+		}
+		else
+		{
+			BenchReport("sched_round", "cycles_per_round", (double)(ReadCycles() - Test18_Start) / Test18_Rounds);
+			BenchReport("sched_latency", "cycles_per_switch", (double)Test18_SwitchCycles / Test18_Switches);
+			BenchReport("sched_latency", "no_switch_pct", 100.0 * Test18_NoSwitches / (Test18_Switches + Test18_NoSwitches));
+		}
+	}
+	Test18_Leave(me);
+	MyExitThread();
+}
+
+void Test18()
+{
+	DPrintf("BENCHMARK: MySchedThread and MyExitThread latency under the selected policy.\n");
+
+	int i;
+
+	Test18_Rounds = BenchIters() / TEST18_SCHEDS;
+	if (Test18_Rounds < 1)
+	{
+		Test18_Rounds = 1;
+	}
+	Test18_Round = Test18_Exited = 0;
+	Test18_Switches = Test18_NoSwitches = Test18_SwitchCycles = 0;
+
+	MyInitThreads();
+
+	for (i = 0; i < 9; i++)
+	{
+		MyCreateThread(Test18_Worker, i);
+	}
+
+	// 0 leaves so only the rounds are measured
+	Test18_Start = ReadCycles();
+	Test18_Leave(0);
+	MyExitThread();
+}
+
+// ********************************
+// 	Test19 is a benchmark
+// ********************************
+// Switch latency and throughput of a yield ping-pong (0 <-> partner) and of a
+// pipeline where the CPU goes 0 -> 1 -> ... -> 9 -> 0.
+// `tester.py scaling` runs 1..ncpu copies at once, one WORKLOAD (pingpong or
+// pipeline) each. Each process has its own threads, so throughput should add up.
+// START_AT (CLOCK_REALTIME seconds) holds every process until the same instant,
+// and each one reports its switches and when it finished relative to it.
+
+static int Test19_Iters;
+static int Test19_Stages[10]; // Thread ID of each pipeline stage, stage 0 is thread 0
+static double Test19_StartAt = 0;
+
+static double Test19_RealTime()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void Test19_WaitForStart()
+{
+	char *startAt = getenv("START_AT");
+
+	if (startAt == NULL)
+	{
+		return;
+	}
+	Test19_StartAt = atof(startAt);
+	while (Test19_RealTime() < Test19_StartAt)
+	{
+		usleep(100);
+	}
+}
+
+void Test19_ReportFinish(const char *name, double switches)
+{
+	if (Test19_StartAt == 0)
+	{
+		return;
+	}
+	BenchReport(name, "switches", switches);
+	BenchReport(name, "finish_us", (Test19_RealTime() - Test19_StartAt) * 1e6);
+}
+
+void Test19_Stage(int stage)
+{
+	int i;
+	for (i = 0; i < Test19_Iters; i++)
+	{
+		MyYieldThread(Test19_Stages[(stage + 1) % 10]);
+	}
+}
+
+void Test19()
+{
+	DPrintf("BENCHMARK: Switch latency and switches/sec of a yield ping-pong and of a 10 thread yield pipeline.\n");
+
+	int i;
+	double start, seconds;
+	unsigned long long cycles;
+	char *workload = getenv("WORKLOAD");
+
+	if (workload != NULL && strcmp(workload, "pingpong") != 0 && strcmp(workload, "pipeline") != 0)
+	{
+		DPrintf("Invalid WORKLOAD = %s (use pingpong or pipeline).\n", workload);
+		Exit();
+	}
+
+	Test19_Iters = BenchIters();
+
+	MyInitThreads();
+
+	Test19_WaitForStart();
+
+	if (workload == NULL || strcmp(workload, "pingpong") == 0)
+	{
+		PingPong(Test19_Iters, PingPongYield, &cycles, &seconds);
+		Test19_ReportFinish("yield_pingpong", 2.0 * Test19_Iters);
+		BenchReport("yield_pingpong", "cycles_per_switch", cycles / (2.0 * Test19_Iters));
+		BenchReport("yield_pingpong", "switches_per_sec", 2.0 * Test19_Iters / seconds);
+	}
+
+	if (workload != NULL && strcmp(workload, "pipeline") != 0)
+	{
+		MyExitThread();
+	}
+
+	// IDs continue after 1, so stages are looked up rather than assumed
+	Test19_Stages[0] = 0;
+	for (i = 1; i <= 9; i++)
+	{
+		Test19_Stages[i] = MyCreateThread(Test19_Stage, i);
+		ASSERT(Test19_Stages[i] > 0, "Pipeline stage must be created.");
+	}
+	start = ReadSeconds();
+	for (i = 0; i < Test19_Iters; i++)
+	{
+		MyYieldThread(Test19_Stages[1]);
+	}
+	Test19_ReportFinish("yield_pipeline", 10.0 * Test19_Iters);
+	BenchReport("yield_pipeline", "switches_per_sec", 10.0 * Test19_Iters / (ReadSeconds() - start));
+
+	// Stages are parked in their last yield, they finish once 0 exits
+	MyExitThread();
+}
+
+// ********************************
+// Test20: Stack guard pages
+// ********************************
+
+// Keeps a frame of 512 bytes per level, the addition stops tail calls
+int Test20_Recurse(int depth)
+{
+	volatile char frame[512];
+	frame[0] = (char)depth;
+	if (depth == 0)
+	{
+		return frame[0];
+	}
+	return Test20_Recurse(depth - 1) + frame[0];
+}
+
+void Test20_Overflow(int param)
+{
+	// About twice the budget, the guard page must stop it half way
+	Test20_Recurse(2 * Guard_Budget / 512 + 16);
+	ASSERT(0, "Overflow must have been caught by the guard page.");
+}
+
+void Test20()
+{
+	DPrintf("TEST: A thread using more than STACKBUDGET bytes of stack must hit its guard page.\n");
+
+#ifndef GUARD
+	// Without guard pages it would silently overwrite the neighbour's stack
+	SKIP("Build with OPTION=-DGUARD to run this test.");
+#else
+	MyInitThreads();
+
+	Guard_ExpectOverflow = 1;
+	MyCreateThread(Test20_Overflow, 0);
+
+	// The guard handler exits when it catches the overflow
+	MyExitThread();
+#endif
+}
+
+// ********************************
+// 	Test21 is a benchmark
+// ********************************
+// Cost of a thread without protection, with a guard page (mprotect on start and
+// exit) and with a software canary (placed on start, checked at exit). Every
+// thread does the same work, using half the budget, and parks once in between.
+// Memory is read from /proc with 9 threads parked: extra VMAs (mprotect splits
+// the stack mapping) compared to no protection, and anonymous pages the mode
+// made resident. Stack pages stay resident once touched, so that one is
+// compared to the mode before, and every mode is warmed up by its timing first.
+
+static int Test21_Mode; // 0: none, 1: guard page, 2: canary
+static int Test21_CanaryBroken = 0;
+static int Test21_Tids[9];
+
+void Test21_Thread(int param)
+{
+	char entry;
+	int tid = MyGetThread();
+
+	if (Test21_Mode == 1)
+	{
+		GuardInstall(tid, &entry);
+	}
+	else if (Test21_Mode == 2)
+	{
+		CanaryPlace(&entry);
+	}
+
+	Test20_Recurse(Guard_Budget / 2 / 512);
+	MyYieldThread(0);
+
+	if (Test21_Mode == 1)
+	{
+		GuardRemove(tid);
+	}
+	else if (Test21_Mode == 2 && !CanaryCheck(&entry))
+	{
+		Test21_CanaryBroken++;
+	}
+}
+
+// VMAs and resident anonymous (not file backed) pages, -1 if /proc can't be read
+void Test21_ReadMemory(long *vmas, long *pages)
+{
+	FILE *f;
+	char line[4096];
+	long size, resident, shared;
+
+	*vmas = *pages = -1;
+
+	f = fopen("/proc/self/maps", "r");
+	if (f != NULL)
+	{
+		*vmas = 0;
+		while (fgets(line, sizeof(line), f) != NULL)
+		{
+			(*vmas)++;
+		}
+		fclose(f);
+	}
+
+	f = fopen("/proc/self/statm", "r");
+	if (f != NULL)
+	{
+		if (fscanf(f, "%ld %ld %ld", &size, &resident, &shared) == 3)
+		{
+			*pages = resident - shared;
+		}
+		fclose(f);
+	}
+}
+
+// 9 threads set up, work and park, then finish. Memory is read while parked.
+void Test21_Round(long *vmas, long *pages)
+{
+	int i;
+
+	for (i = 0; i < 9; i++)
+	{
+		Test21_Tids[i] = MyCreateThread(Test21_Thread, 0);
+	}
+	for (i = 0; i < 9; i++)
+	{
+		MyYieldThread(Test21_Tids[i]);
+	}
+	if (vmas != NULL)
+	{
+		Test21_ReadMemory(vmas, pages);
+	}
+	// Some may already have finished while another one exited
+	for (i = 0; i < 9; i++)
+	{
+		MyYieldThread(Test21_Tids[i]);
+	}
+}
+
+void Test21()
+{
+	DPrintf("BENCHMARK: Thread cost and memory of guard pages vs. software canaries.\n");
+
+#ifdef GUARD
+	// Every thread already has a guard here, so the modes can't be told apart
+	SKIP("Build without -DGUARD to run this benchmark.");
+#else
+	const char *names[3] = {"no_guard", "guard_page", "canary"};
+	int r, rounds = BenchIters() / 9 + 1;
+	long vmas[3], pages[3];
+	unsigned long long start;
+
+	GuardInit();
+	MyInitThreads();
+
+	for (Test21_Mode = 0; Test21_Mode < 3; Test21_Mode++)
+	{
+		start = ReadCycles();
+		for (r = 0; r < rounds; r++)
+		{
+			Test21_Round(NULL, NULL);
+		}
+		BenchReport(names[Test21_Mode], "cycles_per_thread", (ReadCycles() - start) / (9.0 * rounds));
+
+		Test21_Round(&vmas[Test21_Mode], &pages[Test21_Mode]);
+	}
+
+	if (vmas[0] < 0 || pages[0] < 0)
+	{
+		DPrintf("Can't read /proc/self/maps or /proc/self/statm, no memory results.\n");
+	}
+	else
+	{
+		for (Test21_Mode = 1; Test21_Mode < 3; Test21_Mode++)
+		{
+			BenchReport(names[Test21_Mode], "extra_vmas_per_thread", (vmas[Test21_Mode] - vmas[0]) / 9.0);
+			BenchReport(names[Test21_Mode], "extra_rss_bytes_per_thread", (pages[Test21_Mode] - pages[Test21_Mode - 1]) * Guard_PageSize / 9.0);
+		}
+	}
+
+	ASSERT_EQUAL(Test21_CanaryBroken, 0, "No canary must be overwritten.");
+	MyExitThread();
+#endif
+}
+
+// ********************************
+// Test22, Test23: FP/SIMD values across switches
+// ********************************
+// Threads 0, 1 and 2 keep a double, an SSE sized float vector and an AVX sized
+// double vector live across every switch (compilers split the AVX one into two
+// SSE registers without -mavx). The ABI makes every xmm/ymm register
+// caller-saved, so the compiler spills them around the call and this checks
+// that each thread gets its own stack and callee-saved registers back intact.
+// Updates only halve and add small integers, so every value is exact in any
+// rounding mode and can be compared bit for bit.
+// Each thread also runs in its own rounding mode. The rounding control in MXCSR
+// and in the x87 control word is callee-saved too, but a package that switches
+// with plain setjmp/longjmp (like REF) does not keep it per thread, so a lost
+// mode is only a note unless FPENV=1 makes it a failure.
+
+typedef float Vec4f __attribute__((vector_size(16)));
+typedef double Vec4d __attribute__((vector_size(32)));
+
+#define FP_ROUNDS 16 // Values stay exact for this many rounds
+
+// Same encoding in MXCSR bits 13-14 and x87 control word bits 10-11
+#define FP_NEAREST 0
+#define FP_DOWN 1
+#define FP_UP 2
+#define FP_ZERO 3
+
+static const char *FP_ModeName[4] = {"to nearest", "down", "up", "toward zero"};
+static const int FP_Mode[3] = {FP_UP, FP_DOWN, FP_ZERO}; // Rounding mode at each position, none is the default
+static int FP_Ring[3];									 // Thread ID at each position, 0 -> 1 -> 2 -> 0
+static int FP_Steps;									 // Rounds done by all threads, shows who ran in between
+static int FP_Switched, FP_Done;
+
+#if !defined(__i386__) && !defined(__x86_64__)
+static const int FP_FeMode[4] = {FE_TONEAREST, FE_DOWNWARD, FE_UPWARD, FE_TOWARDZERO};
+#endif
+
+static void FPSetRounding(int mode)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	unsigned int mxcsr;
+	unsigned short cw;
+
+	__asm__ __volatile__("stmxcsr %0"
+						 : "=m"(mxcsr));
+	mxcsr = (mxcsr & ~0x6000u) | ((unsigned int)mode << 13);
+	__asm__ __volatile__("ldmxcsr %0"
+						 :
+						 : "m"(mxcsr));
+	__asm__ __volatile__("fnstcw %0"
+						 : "=m"(cw));
+	cw = (cw & ~0x0C00) | (mode << 10);
+	__asm__ __volatile__("fldcw %0"
+						 :
+						 : "m"(cw));
+#else
+	fesetround(FP_FeMode[mode]);
+#endif
+}
+
+// Returns -1 if the SSE and x87 rounding modes disagree
+static int FPGetRounding()
+{
+#if defined(__i386__) || defined(__x86_64__)
+	unsigned int mxcsr;
+	unsigned short cw;
+
+	__asm__ __volatile__("stmxcsr %0"
+						 : "=m"(mxcsr));
+	__asm__ __volatile__("fnstcw %0"
+						 : "=m"(cw));
+	if (((mxcsr >> 13) & 3) != ((cw >> 10) & 3u))
+	{
+		return -1;
+	}
+	return (mxcsr >> 13) & 3;
+#else
+	int mode;
+	for (mode = 0; mode < 4; mode++)
+	{
+		if (FP_FeMode[mode] == fegetround())
+		{
+			return mode;
+		}
+	}
+	return -1;
+#endif
+}
+
+// One round of work, also used without switches to get the expected values
+static inline void FPStep(int pos, double *scalar, Vec4f *vf, Vec4d *vd)
+{
+	const Vec4f halfF = {0.5f, 0.5f, 0.5f, 0.5f};
+	const Vec4f addF = {pos + 1, pos + 1, pos + 1, pos + 1};
+	const Vec4d halfD = {0.5, 0.5, 0.5, 0.5};
+	const Vec4d addD = {pos + 1, -(pos + 1), pos + 2, -(pos + 2)};
+
+	*scalar = *scalar * 0.5 + (pos + 1);
+	*vf = *vf * halfF + addF;
+	*vd = *vd * halfD + addD;
+}
+
+static inline void FPStart(int pos, double *scalar, Vec4f *vf, Vec4d *vd)
+{
+	const Vec4f f = {pos, pos + 0.25f, pos + 0.5f, pos + 0.75f};
+	const Vec4d d = {-pos, pos * 2.0, pos * 4.0, 1.0};
+
+	*scalar = pos + 1;
+	*vf = f;
+	*vd = d;
+}
+
+void FPResetCounters()
+{
+	FP_Steps = FP_Switched = FP_Done = 0;
+}
+
+// useSched: switch with MySchedThread instead of yielding around the ring
+void FPWork(int pos, int useSched)
+{
+	int r, i, same, steps, switched = 0, lost = 0;
+	char *fpenv = getenv("FPENV");
+	double scalar, expScalar;
+	Vec4f vf, expVf;
+	Vec4d vd, expVd;
+
+	FPSetRounding(FP_Mode[pos]);
+
+	FPStart(pos, &expScalar, &expVf, &expVd);
+	for (r = 0; r < FP_ROUNDS; r++)
+	{
+		FPStep(pos, &expScalar, &expVf, &expVd);
+	}
+
+	FPStart(pos, &scalar, &vf, &vd);
+	for (r = 0; r < FP_ROUNDS; r++)
+	{
+		FPStep(pos, &scalar, &vf, &vd);
+		steps = ++FP_Steps;
+		if (useSched)
+		{
+			MySchedThread();
+		}
+		else
+		{
+			MyYieldThread(FP_Ring[(pos + 1) % 3]);
+		}
+		if (FP_Steps != steps)
+		{
+			switched++;
+		}
+		if (FPGetRounding() != FP_Mode[pos])
+		{
+			lost++;
+		}
+	}
+	FPSetRounding(FP_NEAREST);
+
+	FP_Switched += switched;
+	FP_Done++;
+
+	// Nothing ran in between, so nothing was tested
+	if (switched == 0)
+	{
+		if (FP_Done == 3 && FP_Switched == 0)
+		{
+			sprintf(msg, "No switch happened under %s, so FP state across MySchedThread is untested.", Policy->name);
+			SKIP(msg);
+		}
+		return;
+	}
+
+	same = (scalar == expScalar);
+	for (i = 0; i < 4; i++)
+	{
+		same = same && vf[i] == expVf[i] && vd[i] == expVd[i];
+	}
+	sprintf(msg, "Thread %d FP values must survive %d switches (scalar = %g, expected = %g).", MyGetThread(), switched, scalar, expScalar);
+	ASSERT(same, msg);
+
+	sprintf(msg, "Thread %d must keep rounding %s across all %d switches (lost after %d of them).", MyGetThread(), FP_ModeName[FP_Mode[pos]], switched, lost);
+	if (fpenv != NULL && strcmp(fpenv, "1") == 0)
+	{
+		ASSERT_EQUAL(lost, 0, msg);
+	}
+	else if (lost > 0)
+	{
+		DPrintf("ℹ️  NOTE: %s Set FPENV=1 to make this a failure.\n", msg);
+	}
+}
+
+void Test22_Yield(int pos)
+{
+	FPWork(pos, 0);
+}
+
+void Test22()
+{
+	DPrintf("TEST: Threads 0, 1, 2 yield around a ring, FP and SIMD values must survive MyYieldThread.\n");
+
+	MyInitThreads();
+	FPResetCounters();
+
+	FP_Ring[0] = 0;
+	FP_Ring[1] = MyCreateThread(Test22_Yield, 1);
+	FP_Ring[2] = MyCreateThread(Test22_Yield, 2);
+
+	FPWork(0, 0);
+	MyExitThread();
+}
+
+void Test23_Sched(int pos)
+{
+	FPWork(pos, 1);
+}
+
+void Test23()
+{
+	DPrintf("TEST: Threads 0, 1, 2 call MySchedThread, FP and SIMD values must survive it (skipped if the policy never switches).\n");
+
+	MyInitThreads();
+	FPResetCounters();
+
+	MyCreateThread(Test23_Sched, 1);
+	MyCreateThread(Test23_Sched, 2);
+
+	FPWork(0, 1);
+	MyExitThread();
+}
+
+// ********************************
+// 	Test24 is a benchmark
+// ********************************
+// The shared yield ping-pong three ways: plain (as in Test19), with integer
+// values live across every switch, and with FP and vector values live across
+// it. Each loop also runs once without switching, and that time is subtracted,
+// so the rows are the switch cost plus whatever the compiler spills around the
+// call. The three are interleaved over TEST24_RUNS runs, medians are reported.
+
+#define TEST24_RUNS 5
+
+static volatile int Test24_IntSink;
+static volatile double Test24_FPSink;
+
+void Test24_IntLoop(int side, int iters, int to)
+{
+	int i, a = side + 1, b = side + 2, c = side + 3;
+	for (i = 0; i < iters; i++)
+	{
+		a = a * 3 + i;
+		b ^= a >> 3;
+		c += b & 7;
+		PingPongSwitch(to);
+	}
+	Test24_IntSink = a + b + c;
+}
+
+void Test24_FPLoop(int side, int iters, int to)
+{
+	int i;
+	double scalar;
+	Vec4f vf;
+	Vec4d vd;
+
+	FPStart(side, &scalar, &vf, &vd);
+	for (i = 0; i < iters; i++)
+	{
+		FPStep(side, &scalar, &vf, &vd);
+		PingPongSwitch(to);
+	}
+	Test24_FPSink = scalar + vf[0] + vd[0];
+}
+
+// Cycles per switch of a ping-pong running loop, minus loop on its own
+double Test24_SwitchCycles(int iters, void (*loop)(int side, int iters, int to))
+{
+	unsigned long long start, baseline, cycles;
+	double seconds;
+
+	start = ReadCycles();
+	loop(0, 2 * iters, -1);
+	baseline = ReadCycles() - start;
+
+	PingPong(iters, loop, &cycles, &seconds);
+	return ((double)cycles - (double)baseline) / (2.0 * iters);
+}
+
+double Test24_Median(double *values, int n)
+{
+	int i, j;
+	double v;
+
+	for (i = 1; i < n; i++)
+	{
+		v = values[i];
+		for (j = i; j > 0 && values[j - 1] > v; j--)
+		{
+			values[j] = values[j - 1];
+		}
+		values[j] = v;
+	}
+	return values[n / 2];
+}
+
+void Test24()
+{
+	DPrintf("BENCHMARK: Yield ping-pong switch latency, plain vs. integer vs. FP/SIMD values live across switches.\n");
+
+	static const char *names[3] = {"plain_pingpong", "int_pingpong", "fp_pingpong"};
+	void (*loops[3])(int side, int iters, int to) = {PingPongYield, Test24_IntLoop, Test24_FPLoop};
+	double results[3][TEST24_RUNS];
+	int iters = BenchIters();
+	int r, k;
+	unsigned long long cycles;
+	double seconds;
+
+	MyInitThreads();
+
+	// Warm up so the first run is not charged for it
+	PingPong(iters, PingPongYield, &cycles, &seconds);
+
+	for (r = 0; r < TEST24_RUNS; r++)
+	{
+		for (k = 0; k < 3; k++)
+		{
+			results[k][r] = Test24_SwitchCycles(iters, loops[k]);
+		}
+	}
+	for (k = 0; k < 3; k++)
+	{
+		BenchReport(names[k], "cycles_per_switch", Test24_Median(results[k], TEST24_RUNS));
+	}
+
+	MyExitThread();
+}
+
 void Main()
 {
 #ifdef REF
@@ -756,12 +2404,22 @@ void Main()
 	DPrintf("***** Using My Version *****\n");
 #endif
 
-	void (*func_ptr[20])() = {
+#ifdef GUARD
+	GuardInit();
+#endif
+
+#ifdef PROFILE
+	// Most tests finish in MyExitThread and never come back here
+	atexit(ProfReport);
+#endif
+
+	void (*func_ptr[])() = {
 		Test1, Test2, Test3, Test4,
 		Test5, Test6, Test7, Test8,
 		Test9, Test10, Test11, Test12,
 		Test13, Test14, Test15, Test16,
-		Test17};
+		Test17, Test18, Test19, Test20,
+		Test21, Test22, Test23, Test24};
 
 	char *N = getenv("N");
 
@@ -779,8 +2437,23 @@ void Main()
 
 	DPrintf("N is %d.\n", Nint);
 
+	// Policy the package under test implements (FIFO if not given)
+	char *policy = getenv("POLICY");
+	if (policy != NULL)
+	{
+		if (!SelectPolicy(policy))
+		{
+			DPrintf("Invalid POLICY = %s (use FIFO, LIFO or PRIO).\n", policy);
+			Exit();
+		}
+		DPrintf("POLICY is %s.\n", Policy->name);
+	}
+
 	// Run the selected test
 	(*func_ptr[Nint - 1])();
 
+#ifdef PROFILE
+	ProfReport();
+#endif
 	Exit();
 }
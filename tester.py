@@ -1,22 +1,216 @@
 import subprocess
 from subprocess import Popen, PIPE, STDOUT
 import os
+import re
 import argparse
+import multiprocessing
+import time
 
 # Update number here if you add more tests
-N_tests = 17
+N_tests = 24
 
-def run_tests(outputfile, ref_mode=False):
-    print('Make clean pa4tests...'),
-    if ref_mode:
-        subprocess.call('make clean tests OPTION=-DREF', stdout=PIPE, shell=True)
+# Tests that print "BENCH:" lines, run by `bench`
+BENCH_TESTS = [18, 19, 21, 24]
+
+# Throughput benchmark run by `scaling`, one WORKLOAD at a time
+SCALING_TEST = 19
+
+# Build variants for `matrix`, passed through OPTION (name, flags)
+BUILD_VARIANTS = [
+    ('O0', '-O0'),
+    ('O2', '-O2'),
+    ('O3', '-O3'),
+    ('O2-lto', '-O2 -flto'),
+    ('native', '-O2 -march=native'),
+]
+
+# Policies the scheduling model in pa4tests.c knows
+POLICIES = ['FIFO', 'LIFO', 'PRIO']
+
+# Rows printed by ProfReport() in pa4tests.c (PROFILE build)
+# (function, calls, inclusive cycles, exclusive cycles)
+PROFILE_ROW = re.compile(r'^PROFILE: (My\w+)\s+(\d+)\s+(\d+)\s+(\d+)\s+(\d+)')
+
+def merge_profile(total, profile):
+    for name, row in profile.items():
+        prev = total.get(name, (0, 0, 0))
+        total[name] = tuple(a + b for a, b in zip(prev, row))
+
+def format_profile(profile, title):
+    # Inclusive cycles overlap across nested yields, so shares use exclusive cycles
+    lines = [title, '{:<16} {:>12} {:>16} {:>16} {:>14} {:>7}'.format('function', 'calls', 'incl_cycles', 'excl_cycles', 'excl/call', 'excl%')]
+    all_exclusive = sum(row[2] for row in profile.values()) or 1
+    for name, (calls, inclusive, exclusive) in sorted(profile.items(), key=lambda kv: -kv[1][2]):
+        per_call = exclusive // calls if calls else 0
+        lines.append('{:<16} {:>12} {:>16} {:>16} {:>14} {:>6.1f}%'.format(name, calls, inclusive, exclusive, per_call, 100.0 * exclusive / all_exclusive))
+    return '\n'.join(lines) + '\n'
+
+# Lines printed by BenchReport() in pa4tests.c
+BENCH_ROW = re.compile(r'BENCH: (\S+) (\S+) = ([-0-9.]+)')
+
+def make_tests(options):
+    if options:
+        subprocess.call('make clean tests OPTION="{}"'.format(' '.join(options)), stdout=PIPE, shell=True)
     else:
         subprocess.call('make clean tests', stdout=PIPE, shell=True)
 
+def run_bench(test, extra_env, binary='./tests'):
+    """Run one benchmark test, return its output and {(bench, metric): value}."""
+    my_env = os.environ.copy()
+    my_env.update(extra_env)
+    my_env["N"] = str(test)
+    proc = Popen([binary], stdout=PIPE, stderr=STDOUT, env=my_env)
+    output = proc.communicate()[0]
+    results = {}
+    for match in BENCH_ROW.finditer(output):
+        results[(match.group(1), match.group(2))] = float(match.group(3))
+    return output, results
+
+def format_bench(results, columns, title):
+    """results: {column: {(bench, metric): value}}"""
+    rows = sorted(set(key for col in columns for key in results[col]))
+    lines = [title, '{:<40}'.format('benchmark') + ''.join('{:>14}'.format(col) for col in columns)]
+    for key in rows:
+        cells = ['{:>14.1f}'.format(results[col][key]) if key in results[col] else '{:>14}'.format('-') for col in columns]
+        lines.append('{:<40}'.format(' '.join(key)) + ''.join(cells))
+    return '\n'.join(lines) + '\n'
+
+def run_benchmarks(outputfile, policies, iters=None, ref_mode=False):
+    print('Make clean pa4tests...'),
+    make_tests(['-DREF'] if ref_mode else [])
+    print('\t\tDone.')
+
+    results = {}
+    with open(outputfile, 'w') as outFile:
+        for policy in policies:
+            results[policy] = {}
+            extra_env = {'POLICY': policy}
+            if iters:
+                extra_env['ITERS'] = str(iters)
+            for test in BENCH_TESTS:
+                print("* Run benchmark " + str(test) + " (POLICY=" + policy + ")..."),
+                output, test_results = run_bench(test, extra_env)
+                outFile.write('\n-----BENCH' + str(test) + ' ' + policy + '-----\n')
+                outFile.write(output)
+                results[policy].update(test_results)
+                print("\t\t{} results.".format(len(test_results)))
+
+        table = format_bench(results, policies, '\n-----BENCH (per policy)-----')
+        outFile.write(table)
+        print(table)
+
+def run_matrix(outputfile, variants, iters=None, ref_mode=False):
+    extra_env = {'ITERS': str(iters)} if iters else {}
+
+    # Build every variant first, each one under its own name
+    built = []
+    for name, flags in variants:
+        print('Make clean tests (' + flags + ')...'),
+        make_tests((['-DREF'] if ref_mode else []) + [flags])
+        if not os.path.exists('./tests'):
+            print('\t\tBuild failed, skipped.')
+            continue
+        os.rename('./tests', './tests-' + name)
+        built.append(name)
+        print('\t\tDone (tests-' + name + ').')
+
+    results = {}
+    with open(outputfile, 'w') as outFile:
+        for name in built:
+            results[name] = {}
+            for test in BENCH_TESTS:
+                print("* Run benchmark " + str(test) + " on tests-" + name + "..."),
+                output, test_results = run_bench(test, extra_env, binary='./tests-' + name)
+                outFile.write('\n-----BENCH' + str(test) + ' ' + name + '-----\n')
+                outFile.write(output)
+                results[name].update(test_results)
+                print("\t\t{} results.".format(len(test_results)))
+
+        table = format_bench(results, built, '\n-----BENCH (per build variant)-----')
+        outFile.write(table)
+        print(table)
+
+# Workloads of SCALING_TEST (WORKLOAD) and the bench name they report under
+SCALING_WORKLOADS = [('pingpong', 'yield_pingpong'), ('pipeline', 'yield_pipeline')]
+
+def run_scaling(outputfile, max_procs, iters, repeat, ref_mode=False):
+    print('Make clean pa4tests...'),
+    make_tests(['-DREF'] if ref_mode else [])
+    print('\t\tDone.')
+
+    # {procs: {bench: median combined switches/sec over the repeats}}
+    combined = {}
+    with open(outputfile, 'w') as outFile:
+        for procs in range(1, max_procs + 1):
+            combined[procs] = {}
+            for workload, bench in SCALING_WORKLOADS:
+                print("* Run " + workload + " in " + str(procs) + " processes at once, " + str(repeat) + " times..."),
+
+                rates = []
+                for rep in range(repeat):
+                    # Every process waits for START_AT, leave time for all of them to get there
+                    start_at = time.time() + 0.5 + 0.05 * procs
+                    my_env = os.environ.copy()
+                    my_env.update({'N': str(SCALING_TEST), 'ITERS': str(iters), 'WORKLOAD': workload, 'START_AT': repr(start_at)})
+                    running = [Popen(['./tests'], stdout=PIPE, stderr=STDOUT, env=my_env) for _ in range(procs)]
+                    outputs = [proc.communicate()[0] for proc in running]
+
+                    # Total switches over the span from START_AT to the last process finishing,
+                    # so processes that ran alone for a while can't inflate it
+                    switches, finish_us = 0.0, 0.0
+                    for i, output in enumerate(outputs):
+                        outFile.write('\n-----SCALING ' + workload + ' P=' + str(procs) + ' run ' + str(rep) + ' #' + str(i) + '-----\n')
+                        outFile.write(output)
+                        for match in BENCH_ROW.finditer(output):
+                            if match.group(1) != bench:
+                                continue
+                            if match.group(2) == 'switches':
+                                switches += float(match.group(3))
+                            elif match.group(2) == 'finish_us':
+                                finish_us = max(finish_us, float(match.group(3)))
+                    if finish_us > 0:
+                        rates.append(switches / (finish_us / 1e6))
+
+                if rates:
+                    # Median, so one disturbed run can't skew the efficiency
+                    combined[procs][bench] = sorted(rates)[len(rates) // 2]
+                    print("\t\tDone.")
+                else:
+                    print("\t\tNo results.")
+
+        # Efficiency per core: combined throughput vs. P times the single process run
+        benches = [bench for _, bench in SCALING_WORKLOADS]
+        lines = ['\n-----SCALING (switches/sec, combined over P processes)-----',
+                 '{:>4}'.format('P') + ''.join('{:>20}{:>8}'.format(bench, 'eff') for bench in benches)]
+        for procs in sorted(combined):
+            cells = []
+            for bench in benches:
+                total = combined[procs].get(bench, 0.0)
+                single = combined[1].get(bench, 0.0)
+                eff = total / (procs * single) if single else 0.0
+                cells.append('{:>20.0f}{:>7.0f}%'.format(total, 100.0 * eff))
+            lines.append('{:>4}'.format(procs) + ''.join(cells))
+        table = '\n'.join(lines) + '\n'
+        outFile.write(table)
+        print(table)
+
+def run_tests(outputfile, ref_mode=False, profile_mode=False, policy=None, guard_mode=False, fpenv=False):
+    print('Make clean pa4tests...'),
+    options = []
+    if ref_mode:
+        options.append('-DREF')
+    if profile_mode:
+        options.append('-DPROFILE')
+    if guard_mode:
+        options.append('-DGUARD')
+    make_tests(options)
+
     print('\t\tDone.')
 
     print('Running all tests...')
 
+    suite_profile = {}
+
     with open(outputfile, 'w') as outFile:
         # Then run all tests
         for i in range(1, N_tests+1):
@@ -26,15 +220,26 @@ def run_tests(outputfile, ref_mode=False):
             cmd = ['./tests']
             my_env = os.environ.copy()
             my_env["N"] = str(i)
+            if policy:
+                my_env["POLICY"] = policy
+            if fpenv:
+                my_env["FPENV"] = "1"
             # result = Popen(cmd, stdout=outFile, stderr=STDOUT, env=my_env).wait()
 
             proc = Popen(cmd, stdout=PIPE, stderr=STDOUT, env=my_env)
             
             # Detect failure manually
             is_failed = False
+            is_skipped = False
+            test_profile = {}
             for line in proc.stdout:
                 if 'ASSERTION FAILURE:' in line or 'Kernel Panic!' in line: 
                     is_failed = True
+                if 'SKIPPED:' in line:
+                    is_skipped = True
+                match = PROFILE_ROW.match(line)
+                if match:
+                    test_profile[match.group(1)] = (int(match.group(2)), int(match.group(3)), int(match.group(4)))
                 outFile.write(line)
             proc.wait()
 
@@ -44,9 +249,24 @@ def run_tests(outputfile, ref_mode=False):
 
             if is_failed:
                 print("\t\tFailed!?")
+            elif is_skipped:
+                print("\t\tSkipped in this build, see output.")
             else:
                 print("\t\tNo errors encountered, compare with ref to ensure correctness.")
 
+            if test_profile:
+                top = max(test_profile.items(), key=lambda kv: kv[1][2])
+                if top[1][2] > 0:
+                    print("\t\tDominant call: {} ({} exclusive cycles)".format(top[0], top[1][2]))
+                merge_profile(suite_profile, test_profile)
+            elif profile_mode:
+                print("\t\tNo profile table found in output.")
+
+        if suite_profile:
+            table = format_profile(suite_profile, '\n-----PROFILE (all tests)-----')
+            outFile.write(table)
+            print(table)
+
         print("All tests ran (N={}).".format(N_tests))
 
 parser = argparse.ArgumentParser()
@@ -57,25 +277,61 @@ subparsers.required = True
 
 parser_runtests = subparsers.add_parser('runtests', help='Run all tests, write output to a file. Can also be used to generate ref output.')
 parser_runtests.add_argument('-r', '--ref', help='Ref mode, run tests using Prof. version.', action='store_true')
+parser_runtests.add_argument('--policy', help='Scheduling policy the package implements (default FIFO).', choices=POLICIES)
+parser_runtests.add_argument('-g', '--guard', help='Build with -DGUARD, every thread gets a stack guard page (see STACKBUDGET).', action='store_true')
+parser_runtests.add_argument('--fpenv', help='Fail Tests 22/23 if a thread loses its FP rounding mode across a switch (FPENV=1).', action='store_true')
+parser_runtests.add_argument('-p', '--profile', help='Build with -DPROFILE and merge per-test API profiles into a suite table.', action='store_true')
+
+parser_bench = subparsers.add_parser('bench', help='Run benchmark tests under one or more policies and compare them.')
+parser_bench.add_argument('-r', '--ref', help='Ref mode, run benchmarks using Prof. version.', action='store_true')
+parser_bench.add_argument('--policy', help='Policies to run (default FIFO). The package must implement each one, e.g. by reading POLICY.', nargs='+', choices=POLICIES, default=['FIFO'])
+parser_bench.add_argument('--iters', help='Iterations per benchmark (ITERS).', type=int)
+
+parser_matrix = subparsers.add_parser('matrix', help='Build tests with several compiler flag variants and compare all benchmarks across them.')
+parser_matrix.add_argument('-r', '--ref', help='Ref mode, use Prof. version.', action='store_true')
+parser_matrix.add_argument('--variants', help='Variants to build (default: all).', nargs='+', choices=[name for name, _ in BUILD_VARIANTS])
+parser_matrix.add_argument('--iters', help='Iterations per benchmark (ITERS).', type=int)
+
+parser_scaling = subparsers.add_parser('scaling', help='Run the throughput benchmark in P = 1..ncpu processes at once and report efficiency per core.')
+parser_scaling.add_argument('-r', '--ref', help='Ref mode, use Prof. version.', action='store_true')
+parser_scaling.add_argument('--max-procs', help='Largest P (default: number of CPUs).', type=int, default=multiprocessing.cpu_count())
+parser_scaling.add_argument('--iters', help='Iterations per process (ITERS), keep it large so the runs overlap.', type=int, default=1000000)
+parser_scaling.add_argument('--repeat', help='Runs per P, the median is reported (default: 5).', type=int, default=5)
 
 args = parser.parse_args()
 
 print(args)
 
-if args.which == 'runtests':
+if not os.path.exists('./tester'):
+    os.makedirs('./tester')
+    print("Folder 'testers' created.")
+else:
+    print("Folder 'testers' already exists.")
 
-    if not os.path.exists('./tester'):
-        os.makedirs('./tester')
-        print("Folder 'testers' created.")
-    else:
-        print("Folder 'testers' already exists.")
+if args.which == 'runtests':
 
     is_refmode = args.ref
     if is_refmode:
         print("\nRun tests in REF mode (ref_outputs.txt)...\n")
-        run_tests('./tester/ref_outputs.txt', ref_mode=True)
+        run_tests('./tester/ref_outputs.txt', ref_mode=True, profile_mode=args.profile, policy=args.policy, guard_mode=args.guard, fpenv=args.fpenv)
         print("Check output at `ref_outputs.txt`.")
     else:
         print("\nRun tests in My mode (test_outputs.txt)...\n")
-        run_tests('./tester/test_outputs.txt', ref_mode=False)
+        run_tests('./tester/test_outputs.txt', ref_mode=False, profile_mode=args.profile, policy=args.policy, guard_mode=args.guard, fpenv=args.fpenv)
         print("Check output at `test_outputs.txt`.")
+
+elif args.which == 'bench':
+
+    run_benchmarks('./tester/bench_outputs.txt', args.policy, iters=args.iters, ref_mode=args.ref)
+    print("Check output at `bench_outputs.txt`.")
+
+elif args.which == 'scaling':
+
+    run_scaling('./tester/scaling_outputs.txt', args.max_procs, args.iters, args.repeat, ref_mode=args.ref)
+    print("Check output at `scaling_outputs.txt`.")
+
+elif args.which == 'matrix':
+
+    variants = [v for v in BUILD_VARIANTS if not args.variants or v[0] in args.variants]
+    run_matrix('./tester/matrix_outputs.txt', variants, iters=args.iters, ref_mode=args.ref)
+    print("Check output at `matrix_outputs.txt`.")